@@ -0,0 +1,625 @@
+/*
+ * Copyright (c) 2014, Tsuyoshi Tanai <skmt.japan@gmail.com>,
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE. 
+*/
+
+/*----------------------------------------------------------------------------
+ * include file
+ *----------------------------------------------------------------------------
+*/
+#include "mtrace.h"
+
+
+/*----------------------------------------------------------------------------
+ * macro
+ *----------------------------------------------------------------------------
+*/
+#define ITER		5		/* runs of a benchmark, the best is shown */
+
+
+/*----------------------------------------------------------------------------
+ * type definition
+ *----------------------------------------------------------------------------
+ *
+ * "make bench" runs every benchmark on one corpus and prints a line per
+ * benchmark, tab separated under a header, so the output of two versions
+ * can be diffed or fed to awk:
+ *
+ *   bench  unit  n  ns_per_op  ops_per_sec  mb_per_sec  alloc_bytes
+ *
+ * ns_per_op is the best of ITER runs, alloc_bytes what one run asked
+ * xmalloc() and friends for (see MT_STAT_ALLOCSZ).  mb_per_sec is of the
+ * log text, "-" for benchmarks not reading it.
+ *
+*/
+typedef struct _corpus {
+	char *path;
+	char *data;		/* the whole file */
+	size_t size;
+	char **line;		/* into data, not terminated */
+	size_t *len;
+	long nline;
+} Corpus;
+
+typedef struct _cell {
+	struct _cell *next;
+	char *key;
+} Cell;
+
+
+/*----------------------------------------------------------------------------
+ * prototype
+ *----------------------------------------------------------------------------
+*/
+static void bn_usage(void);
+static void bn_load(Corpus *, char *);
+static void bn_print(char *, char *, long, unsigned long long, size_t, count_t);
+static void bn_getlog(Corpus *);
+static void bn_split(Corpus *);
+static void bn_parse(Corpus *, Opt *);
+static void bn_store(Corpus *, Opt *);
+static void bn_lookup(void);
+static void bn_hash(void);
+static void bn_msort(void);
+static void bn_convsec(Corpus *);
+static void bn_e2e(Corpus *, char *, int);
+static unsigned long long bn_pipe(char *, long *);
+static void bn_sort(Corpus *, char *);
+
+
+/*----------------------------------------------------------------------------
+ * global variable
+ *----------------------------------------------------------------------------
+*/
+int debug = 1;
+
+
+/*----------------------------------------------------------------------------
+ * corpus, all in memory
+ *----------------------------------------------------------------------------
+*/
+void
+bn_load(Corpus *cp, char *path) {
+	struct stat fs;
+	FILE *fp;
+	char *p, *end, *nl;
+
+	if ((fp = fopen(path, "r")) == NULL || fstat(fileno(fp), &fs) != 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		exit (1);
+	}
+
+	cp->path = path;
+	cp->size = fs.st_size;
+	cp->data = xmalloc(cp->size + 1);
+	if (fread(cp->data, 1, cp->size, fp) != cp->size) {
+		fprintf(stderr, "%s: short read\n", path);
+		exit (1);
+	}
+	fclose(fp);
+
+	cp->nline = 0;
+	for (p = cp->data, end = p + cp->size; p < end; p = nl + 1) {
+		if ((nl = memchr(p, '\n', end - p)) == NULL)
+			nl = end;
+		++(cp->nline);
+	}
+	cp->line = xmalloc((cp->nline + 1) * sizeof(char *));
+	cp->len = xmalloc((cp->nline + 1) * sizeof(size_t));
+	cp->nline = 0;
+	for (p = cp->data; p < end; p = nl + 1) {
+		if ((nl = memchr(p, '\n', end - p)) == NULL)
+			nl = end;
+		cp->line[cp->nline] = p;
+		cp->len[cp->nline++] = nl - p;
+	}
+
+	return;
+}
+
+
+/*----------------------------------------------------------------------------
+ * print a result
+ *----------------------------------------------------------------------------
+*/
+void
+bn_print(char *name, char *unit, long n, unsigned long long ns, size_t bytes,
+	 count_t alloc) {
+	double op = (n > 0 ? (double)ns / n : 0.0);
+
+	fprintf(stdout, "%s\t%s\t%ld\t%.1f\t%.0f", name, unit, n, op,
+		(ns > 0 ? n * 1e9 / ns : 0.0));
+	if (bytes > 0)
+		fprintf(stdout, "\t%.1f", (ns > 0 ? bytes * 1e9 / ns / (1024 * 1024) : 0.0));
+	else
+		fprintf(stdout, "\t-");
+	fprintf(stdout, "\t%lu\n", alloc);
+	fflush(stdout);
+
+	return;
+}
+
+/*
+ * run "body" ITER times, keep the fastest run and what it allocated
+*/
+#define BN_RUN(best, alloc, body) \
+{ \
+	unsigned long long t0_, ns_; \
+	count_t a0_; \
+	int it_; \
+	(best) = ~0ULL; \
+	for (it_ = 0; it_ < ITER; ++it_) { \
+		a0_ = __mt_stat[MT_STAT_ALLOCSZ]; \
+		t0_ = mt_clock(); \
+		body; \
+		ns_ = mt_clock() - t0_; \
+		(alloc) = __mt_stat[MT_STAT_ALLOCSZ] - a0_; \
+		if (ns_ < (best)) \
+			(best) = ns_; \
+	} \
+}
+
+
+/*----------------------------------------------------------------------------
+ * parser: getlog_r() from the file, split() from memory, records
+ *----------------------------------------------------------------------------
+ *
+ * store_smfield() is static and runs inside split(), so "split" is
+ * header decoding, split() and store_smfield() together.
+ *
+*/
+void
+bn_getlog(Corpus *cp) {
+	unsigned long long ns;
+	count_t alloc;
+	getlog_ctx *ctx;
+	off_t n;
+	FILE *fp;
+
+	if ((ctx = getlog_ctx_create()) == NULL)
+		exit (1);
+	BN_RUN(ns, alloc, {
+		if ((fp = fopen(cp->path, "r")) == NULL)
+			exit (1);
+		while (getlog_r(ctx, fp, &n) != NULL) { }
+		fclose(fp);
+	});
+	getlog_ctx_destroy(ctx);
+	bn_print("getlog", "line", cp->nline, ns, cp->size, alloc);
+
+	return;
+}
+
+void
+bn_split(Corpus *cp) {
+	unsigned long long ns;
+	count_t alloc;
+	getlog_ctx *ctx;
+	long i;
+
+	if ((ctx = getlog_ctx_create()) == NULL)
+		exit (1);
+	BN_RUN(ns, alloc, {
+		for (i = 0; i < cp->nline; ++i)
+			getlog_line_r(ctx, cp->line[i], cp->len[i]);
+	});
+	getlog_ctx_destroy(ctx);
+	bn_print("split", "line", cp->nline, ns, cp->size, alloc);
+
+	return;
+}
+
+void
+bn_parse(Corpus *cp, Opt *opt) {
+	unsigned long long ns;
+	count_t alloc;
+	getlog_ctx *ctx;
+	Mtrec rec;
+	long i;
+
+	if ((ctx = getlog_ctx_create()) == NULL)
+		exit (1);
+	BN_RUN(ns, alloc, {
+		for (i = 0; i < cp->nline; ++i) {
+			if (getlog_line_r(ctx, cp->line[i], cp->len[i]) == NULL)
+				continue;
+			if (mt_parse_record(ctx, opt, &rec) != MT_REC_NONE)
+				mt_free_record(&rec);
+		}
+	});
+	getlog_ctx_destroy(ctx);
+	bn_print("parse", "line", cp->nline, ns, cp->size, alloc);
+
+	return;
+}
+
+
+/*----------------------------------------------------------------------------
+ * hash tables: insert, lookup and mt_hash()
+ *----------------------------------------------------------------------------
+ *
+ * the tables only grow, so the insert is timed once; the lookups then
+ * search every entry stored.
+ *
+*/
+void
+bn_store(Corpus *cp, Opt *opt) {
+	unsigned long long t0, ns;
+	count_t a0;
+	getlog_ctx *ctx;
+	Mtrec *rec;
+	long i, n;
+
+	if ((ctx = getlog_ctx_create()) == NULL)
+		exit (1);
+	rec = xmalloc(cp->nline * sizeof(Mtrec));
+	for (i = n = 0; i < cp->nline; ++i) {
+		if (getlog_line_r(ctx, cp->line[i], cp->len[i]) != NULL &&
+		    mt_parse_record(ctx, opt, &rec[n]) != MT_REC_NONE)
+			++n;
+	}
+	getlog_ctx_destroy(ctx);
+
+	mt_init_msgtbl();
+	a0 = __mt_stat[MT_STAT_ALLOCSZ];
+	t0 = mt_clock();
+	for (i = 0; i < n; i += MT_PROBE_BATCH)
+		mt_store_batch(rec + i, (n - i < MT_PROBE_BATCH ? n - i : MT_PROBE_BATCH));
+	ns = mt_clock() - t0;
+	bn_print("insert", "record", n, ns, 0, __mt_stat[MT_STAT_ALLOCSZ] - a0);
+	xfree(rec);
+
+	return;
+}
+
+void
+bn_lookup(void) {
+	unsigned long long ns;
+	count_t alloc;
+	Hostinfo *hp;
+	Msg *mp;
+	long n = 0;
+	int i;
+
+	BN_RUN(ns, alloc, {
+		n = 0;
+		for (i = 0; i < INIT_TABLE_SIZE; ++i) {
+			for (mp = msgtbl[i]; mp != NULL; mp = mp->next, ++n) {
+				if (mt_msgid_search(mp, 0) == NULL)
+					exit (1);
+			}
+			for (hp = qidtbl[i]; hp != NULL; hp = hp->nextqid, ++n) {
+				if (mt_qid_search(hp, 0) == NULL)
+					exit (1);
+			}
+		}
+	});
+	bn_print("lookup", "key", n, ns, 0, alloc);
+
+	return;
+}
+
+void
+bn_hash(void) {
+	unsigned long long ns;
+	count_t alloc;
+	unsigned int h = 0;
+	Hostinfo *hp;
+	Msg *mp;
+	char **key;
+	long i, n;
+
+	for (n = i = 0; i < INIT_TABLE_SIZE; ++i) {
+		for (mp = msgtbl[i]; mp != NULL; mp = mp->next)
+			++n;
+		for (hp = qidtbl[i]; hp != NULL; hp = hp->nextqid)
+			++n;
+	}
+	key = xmalloc((n + 1) * sizeof(char *));
+	for (n = i = 0; i < INIT_TABLE_SIZE; ++i) {
+		for (mp = msgtbl[i]; mp != NULL; mp = mp->next)
+			key[n++] = mp->msgid;
+		for (hp = qidtbl[i]; hp != NULL; hp = hp->nextqid)
+			key[n++] = hp->qid;
+	}
+
+	BN_RUN(ns, alloc, {
+		for (i = 0; i < n; ++i)
+			h += mt_hash(key[i]);
+	});
+	if (h == 1)
+		fprintf(stderr, "\n");	/* keep the sum alive */
+	bn_print("mt_hash", "key", n, ns, 0, alloc);
+	xfree(key);
+
+	return;
+}
+
+
+/*----------------------------------------------------------------------------
+ * msort() of the stored queue-ids, in table order
+ *----------------------------------------------------------------------------
+*/
+void
+bn_msort(void) {
+	unsigned long long t0, ns, best = ~0ULL;
+	Cell *cell, *list;
+	Hostinfo *hp;
+	long i, n;
+	int it;
+
+	for (n = i = 0; i < INIT_TABLE_SIZE; ++i)
+		for (hp = qidtbl[i]; hp != NULL; hp = hp->nextqid)
+			++n;
+	if (n == 0)
+		return;
+	cell = xmalloc(n * sizeof(Cell));
+
+	for (it = 0; it < ITER; ++it) {
+		for (n = i = 0; i < INIT_TABLE_SIZE; ++i) {
+			for (hp = qidtbl[i]; hp != NULL; hp = hp->nextqid, ++n) {
+				cell[n].key = hp->qid;
+				cell[n].next = &cell[n + 1];
+			}
+		}
+		cell[n - 1].next = NULL;
+
+		t0 = mt_clock();
+		list = msort(cell, offsetof(Cell, next), offsetof(Cell, key), scomp);
+		ns = mt_clock() - t0;
+		if (ns < best)
+			best = ns;
+		for (i = 1; list->next != NULL; list = list->next, ++i) {
+			if (strcmp(list->key, list->next->key) > 0)
+				exit (1);
+		}
+		if (i != n)
+			exit (1);
+	}
+	bn_print("msort", "elem", n, best, 0, 0);
+	xfree(cell);
+
+	return;
+}
+
+
+/*----------------------------------------------------------------------------
+ * convsec() of the delay= of the corpus
+ *----------------------------------------------------------------------------
+*/
+void
+bn_convsec(Corpus *cp) {
+	unsigned long long ns;
+	count_t alloc;
+	getlog_ctx *ctx;
+	char **delay, *p;
+	sec_t sum = 0;
+	long i, n;
+
+	if ((ctx = getlog_ctx_create()) == NULL)
+		exit (1);
+	delay = xmalloc((cp->nline + 1) * sizeof(char *));
+	for (i = n = 0; i < cp->nline; ++i) {
+		if (getlog_line_r(ctx, cp->line[i], cp->len[i]) != NULL &&
+		    (p = get_smfield_r(ctx, SM_DELAY)) != NULL)
+			delay[n++] = xstrdup(p);
+	}
+	getlog_ctx_destroy(ctx);
+
+	BN_RUN(ns, alloc, {
+		for (i = 0; i < n; ++i)
+			sum += convsec(delay[i]);
+	});
+	if (sum == 1)
+		fprintf(stderr, "\n");	/* keep the sum alive */
+	bn_print("convsec", "field", n, ns, 0, alloc);
+
+	for (i = 0; i < n; ++i)
+		xfree(delay[i]);
+	xfree(delay);
+
+	return;
+}
+
+
+/*----------------------------------------------------------------------------
+ * end to end: mtrace itself on the corpus
+ *----------------------------------------------------------------------------
+ *
+ * the count of the allocations comes from --stats of the child.
+ *
+*/
+void
+bn_e2e(Corpus *cp, char *mtrace, int nthread) {
+	unsigned long long t0, ns, best = ~0ULL;
+	count_t alloc = 0;
+	char cmd[BUFSIZ], buf[BUFSIZ], name[32];
+	double mb;
+	FILE *pp;
+	int it;
+
+	snprintf(cmd, sizeof(cmd), "%s --stats -j %d -r nobody@nowhere %s 2>&1 >/dev/null",
+		 mtrace, nthread, cp->path);
+	for (it = 0; it < ITER; ++it) {
+		t0 = mt_clock();
+		if ((pp = popen(cmd, "r")) == NULL) {
+			fprintf(stderr, "can not run %s\n", mtrace);
+			exit (1);
+		}
+		while (fgets(buf, sizeof(buf), pp) != NULL) {
+			if (sscanf(buf, "alloc: %*u calls, %lf MB", &mb) == 1)
+				alloc = (count_t)(mb * 1024 * 1024);
+		}
+		if (pclose(pp) != 0) {
+			fprintf(stderr, "%s failed\n", cmd);
+			exit (1);
+		}
+		ns = mt_clock() - t0;
+		if (ns < best)
+			best = ns;
+	}
+	snprintf(name, sizeof(name), "e2e-j%d", nthread);
+	bn_print(name, "line", cp->nline, best, cp->size, alloc);
+
+	return;
+}
+
+
+/*----------------------------------------------------------------------------
+ * --sort=time against sort(1)
+ *----------------------------------------------------------------------------
+ *
+ * the traces of the commonest recipient of the corpus, one per NDJSON
+ * line: unsorted, sorted by mtrace, and unsorted through sort(1).  the
+ * last two over the first are what sorting costs either way.
+ *
+*/
+unsigned long long
+bn_pipe(char *cmd, long *nout) {
+	unsigned long long t0, ns, best = ~0ULL;
+	char buf[BUFSIZ];
+	FILE *pp;
+	int it;
+
+	for (it = 0; it < ITER; ++it) {
+		t0 = mt_clock();
+		if ((pp = popen(cmd, "r")) == NULL) {
+			fprintf(stderr, "can not run %s\n", cmd);
+			exit (1);
+		}
+		for (*nout = 0; fgets(buf, sizeof(buf), pp) != NULL; ) {
+			if (strchr(buf, '\n') != NULL)
+				++(*nout);
+		}
+		if (pclose(pp) != 0) {
+			fprintf(stderr, "%s failed\n", cmd);
+			exit (1);
+		}
+		ns = mt_clock() - t0;
+		if (ns < best)
+			best = ns;
+	}
+
+	return (best);
+}
+
+void
+bn_sort(Corpus *cp, char *mtrace) {
+	static char *run[][2] = {
+		{ "sort-none",	"%s --format=ndjson -r '%s' %s 2>/dev/null" },
+		{ "sort-time",	"%s --format=ndjson --sort=time -r '%s' %s 2>/dev/null" },
+		{ "sort-pipe",	"%s --format=ndjson -r '%s' %s 2>/dev/null | LC_ALL=C sort" },
+	};
+	unsigned long long ns;
+	char cmd[BUFSIZ], *rcpt;
+	getlog_ctx *ctx;
+	Topkent *top;
+	Topk *tk;
+	long i, n;
+	int j;
+
+	if ((ctx = getlog_ctx_create()) == NULL)
+		exit (1);
+	tk = topk_create(16);
+	for (i = 0; i < cp->nline; ++i) {
+		if (getlog_line_r(ctx, cp->line[i], cp->len[i]) == NULL)
+			continue;
+		for (j = 0; (rcpt = get_smfield_to_r(ctx, j)) != NULL; ++j) {
+			if (*rcpt != '\0')
+				topk_add(tk, rcpt);
+		}
+	}
+	getlog_ctx_destroy(ctx);
+	top = topk_result(tk, 1, &j);
+	if (j == 0) {
+		xfree(top);
+		topk_destroy(tk);
+		return;
+	}
+
+	for (j = 0; j < (int)(sizeof(run) / sizeof(run[0])); ++j) {
+		snprintf(cmd, sizeof(cmd), run[j][1], mtrace, top[0].key, cp->path);
+		ns = bn_pipe(cmd, &n);
+		bn_print(run[j][0], "trace", n, ns, 0, 0);
+	}
+	xfree(top);
+	topk_destroy(tk);
+
+	return;
+}
+
+
+/*----------------------------------------------------------------------------
+ * main
+ *----------------------------------------------------------------------------
+*/
+void
+bn_usage(void) {
+	fprintf(stderr, "usage: mtbench logfile [mtrace]\n");
+	exit (1);
+}
+
+int
+main(int argc, char **argv) {
+	Corpus corpus;
+	Opt opt;
+
+	if (argc < 2 || argc > 3)
+		bn_usage();
+
+	bn_load(&corpus, argv[1]);
+
+	/*
+	 * as "mtrace -r nobody@nowhere": every sender is stored
+	*/
+	memset(&opt, 0, sizeof(Opt));
+	opt.receiver = "nobody@nowhere";
+
+	fprintf(stdout, "# corpus %s %ld lines %lu bytes\n", corpus.path,
+		corpus.nline, (unsigned long)corpus.size);
+	fprintf(stdout, "bench\tunit\tn\tns_per_op\tops_per_sec\tmb_per_sec\talloc_bytes\n");
+	bn_getlog(&corpus);
+	bn_split(&corpus);
+	bn_parse(&corpus, &opt);
+	bn_convsec(&corpus);
+	bn_store(&corpus, &opt);
+	bn_lookup();
+	bn_hash();
+	bn_msort();
+	if (argc == 3) {
+		bn_e2e(&corpus, argv[2], 0);
+		bn_e2e(&corpus, argv[2], 4);
+		bn_sort(&corpus, argv[2]);
+	}
+
+	exit (0);
+}
+
+/* end of source */